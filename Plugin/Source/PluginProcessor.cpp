@@ -0,0 +1,182 @@
+/*
+  AnymaPalPlugin - AnymaPal as a MIDI effect inside the DAW (VST3, LV2)
+
+  The DAW track records from Anyma Phi through this effect. Param state SYSEX
+  is replaced by the equivalent CC at the same sample offset, patch dumps
+  (unless unchanged, see "Only changed dumps") and everything else pass
+  through untouched. No virtual port, no extra OS hop.
+
+  The anyma session follows the host transport: recording starts a take
+  (patch request, editor mode, status updates), stopping ends it. The
+  "Active" parameter switches the session off altogether.
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include "../../Source/AnymaSession.h"
+#include "../../Source/AnymaTranslator.h"
+#include "../../Source/DumpFilter.h"
+
+class AnymaPalPlugin
+      : public juce::AudioProcessor
+      , private juce::AsyncUpdater
+{
+private:
+  std::unique_ptr<juce::MidiOutput> midiToAnyma;
+
+  // patch requests, editor mode and status updates to anyma hardware
+  AnymaSession session;
+
+  juce::AudioParameterBool* activeParam; // owned by AudioProcessor
+  juce::AudioParameterBool* onlyChangedDumpsParam;
+
+  DumpFilter dumpFilter; // audio thread only
+
+  // take state seen in processBlock, acted on in handleAsyncUpdate
+  std::atomic<bool> isTakeWanted { false };
+  bool wasTakeWanted = false; // audio thread only
+
+  juce::MidiBuffer midiOut; // scratch, copied back into the host buffer each block
+  const int midiOutBytes = 8192; // room for a patch dump plus cc
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AnymaPalPlugin)
+
+public:
+  AnymaPalPlugin()
+    : AudioProcessor( BusesProperties() ) // midi effect, no audio buses
+  {
+    addParameter( activeParam = new juce::AudioParameterBool( { "active", 1 }, "Active", true ) );
+    addParameter( onlyChangedDumpsParam = new juce::AudioParameterBool( { "onlyChangedDumps", 1 }, "Only changed dumps", true ) );
+
+    // the end of take dump would arrive after the host stopped recording
+    session.setPatchRequestOnStop( false );
+  }
+
+  ~AnymaPalPlugin() override
+  {
+    cancelPendingUpdate();
+    session.setOutput( nullptr );
+  }
+
+#pragma mark enable/disable processing
+  void prepareToPlay( double /*sampleRate*/, int /*samplesPerBlock*/ ) override
+  {
+    // processBlock only adds to midiOut and copies into the host buffer, both
+    // within this capacity, so nothing allocates there
+    midiOut.ensureSize( (size_t) midiOutBytes );
+
+    if( midiToAnyma == nullptr ) setOutputToAnyma( "Anyma Phi" );
+  }
+
+  void releaseResources() override
+  {
+    isTakeWanted = false;
+    wasTakeWanted = false;
+    triggerAsyncUpdate();
+  }
+
+  // message thread, after processBlock saw the take state change
+  void handleAsyncUpdate() override
+  {
+    isTakeWanted ? session.start() : session.stop();
+  }
+
+  // a take runs while the host records and the plugin is active
+  void updateTakeState()
+  {
+    bool isRecording = false;
+    if( auto* playHead = getPlayHead() )
+      if( auto position = playHead->getPosition() )
+        isRecording = position->getIsRecording();
+
+    const bool takeWanted = isRecording && activeParam->get();
+    if( takeWanted == wasTakeWanted ) return;
+
+    wasTakeWanted = takeWanted;
+    isTakeWanted = takeWanted;
+    triggerAsyncUpdate();
+  }
+
+#pragma mark midi tx and rx
+  void processBlock( juce::AudioBuffer<float>& audio, juce::MidiBuffer& midi ) override
+  {
+    audio.clear();
+    midiOut.clear();
+    updateTakeState();
+    dumpFilter.setForwardOnlyChanged( onlyChangedDumpsParam->get() );
+
+    for( const auto meta : midi )
+    {
+      const uint8_t* rx = meta.data; // incl 0xF0 and 0xF7 terminator
+
+      // is sysex param state? tx MIDI CC at the same sample offset
+      if( AnymaSyx::isParamState( rx, meta.numBytes ) )
+      {
+        juce::MidiMessage cc;
+        if( AnymaTranslator::toCC( rx, meta.numBytes, cc ) )
+          midiOut.addEvent( cc, meta.samplePosition );
+        continue;
+      }
+
+      // patchdump unchanged since the last one passed? hash and compare only
+      if( AnymaSyx::isPatchDump( rx, meta.numBytes )
+          && ! dumpFilter.isForwardRequired( DumpFilter::hashDump( rx, meta.numBytes ) ) )
+        continue;
+
+      // patchdump, notes etc pass through
+      midiOut.addEvent( rx, meta.numBytes, meta.samplePosition );
+    }
+
+    // copy back rather than swap, midiOut keeps the capacity reserved above.
+    // cc is shorter than the sysex it replaces, so this fits the host's buffer
+    midi.clear();
+    midi.addEvents( midiOut, 0, -1, 0 );
+  }
+
+#pragma mark midi system ports
+  void setOutputToAnyma( const juce::String& preferredName )
+  {
+    for( auto& device : juce::MidiOutput::getAvailableDevices() )
+    {
+      if( device.name != preferredName ) continue;
+
+      midiToAnyma = juce::MidiOutput::openDevice( device.identifier );
+      session.setOutput( midiToAnyma.get() );
+      return;
+    }
+  }
+
+#pragma mark plugin boilerplate
+  const juce::String getName() const override    { return JucePlugin_Name; }
+
+  bool acceptsMidi() const override              { return true; }
+  bool producesMidi() const override             { return true; }
+  bool isMidiEffect() const override             { return true; }
+  double getTailLengthSeconds() const override   { return 0.0; }
+
+  int getNumPrograms() override                  { return 1; }
+  int getCurrentProgram() override               { return 0; }
+  void setCurrentProgram( int ) override         {}
+  const juce::String getProgramName( int ) override { return {}; }
+  void changeProgramName( int, const juce::String& ) override {}
+
+  bool hasEditor() const override                { return false; }
+  juce::AudioProcessorEditor* createEditor() override { return nullptr; }
+
+  void getStateInformation( juce::MemoryBlock& destData ) override
+  {
+    juce::MemoryOutputStream out( destData, false );
+    out.writeBool( activeParam->get() );
+    out.writeBool( onlyChangedDumpsParam->get() );
+  }
+
+  void setStateInformation( const void* data, int sizeInBytes ) override
+  {
+    juce::MemoryInputStream in( data, (size_t) sizeInBytes, false );
+    if( ! in.isExhausted() ) *activeParam = in.readBool();
+    if( ! in.isExhausted() ) *onlyChangedDumpsParam = in.readBool();
+  }
+};
+
+// createPluginFilter() called by the plugin wrapper
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter() { return new AnymaPalPlugin(); }
@@ -0,0 +1,115 @@
+/*
+  AnymaSession
+  The start/stop conversation with the anyma hardware, shared by the
+  standalone app (MidiProcessor) and the plugin (PluginProcessor):
+  start - request patch state, then editor mode and regular status updates
+  stop  - cease status updates, then request patch state again
+  Delays between steps run on a timer, nothing blocks the message thread.
+*/
+
+#pragma once
+
+#ifndef JUCE_AUDIO_BASICS_H_INCLUDED // plugin build brings its own JuceHeader
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+
+#include "SyxRepeater.h"
+#include "AnymaTranslator.h"
+
+//
+class AnymaSession : private juce::Timer
+{
+private:
+  enum Phase { idle, starting, active, stopping };
+  Phase phase = idle;
+
+  // delays allowing a patch dump to complete, or state to change
+  const int startDelayMs = 1000;
+  const int stopDelayMs = 5000;
+  bool patchRequestOnStop = true;
+
+  // regularly TX to anyma hardware
+  SyxRepeater anymaKeepAlive;
+  SyxRepeater anymaGetStatus;
+
+  MidiOutput* midiToAnyma = nullptr; // owned by the front end
+
+public:
+  AnymaSession()
+  {
+    anymaKeepAlive.setMsg( AnymaSyx::keepAlive, 3 );
+    anymaKeepAlive.setInterval( 1000 );
+
+    anymaGetStatus.setMsg( AnymaSyx::getStatus, 5 );
+    anymaGetStatus.setInterval( 200 );
+  }
+
+  void setOutput( MidiOutput* outputPort )
+  {
+    midiToAnyma = outputPort;
+    anymaKeepAlive.setOutput( outputPort );
+    anymaGetStatus.setOutput( outputPort );
+  }
+
+  /** the plugin turns this off: the dump would arrive after recording stopped */
+  void setPatchRequestOnStop( const bool shouldRequest ){ patchRequestOnStop = shouldRequest; }
+
+  bool isActive(){ return phase == starting || phase == active; }
+  void toggle(){ isActive() ? stop() : start(); }
+
+  void start()
+  {
+    if( isActive() ) return;
+    stopTimer(); // abandon a pending stop
+
+    // request the anyma hardware send us the current patch state
+    send( AnymaSyx::patch, 7 );
+
+    // editor mode once the patch dump has had time to complete
+    phase = starting;
+    startTimer( startDelayMs );
+  }
+
+  void stop()
+  {
+    if( ! isActive() ) return;
+    stopTimer(); // abandon a pending start
+
+    // cease transmision of editor status requests
+    anymaKeepAlive.stop();
+    anymaGetStatus.stop();
+
+    if( ! patchRequestOnStop ) { phase = idle; return; }
+
+    // patch state once the anyma has had time to change state
+    phase = stopping;
+    startTimer( stopDelayMs );
+  }
+
+  void timerCallback() override
+  {
+    stopTimer();
+
+    if( phase == starting )
+    {
+      // begin anyma editor mode and request regular updates
+      send( AnymaSyx::eMode, 7 );
+      anymaKeepAlive.start();
+      anymaGetStatus.start();
+      phase = active;
+    }
+    else if( phase == stopping )
+    {
+      // request the anyma hardware send us the current patch state
+      send( AnymaSyx::patch, 7 );
+      phase = idle;
+    }
+  }
+
+private:
+  void send( const uint8_t* data, const int numBytes )
+  {
+    if( midiToAnyma == nullptr ) return;
+    midiToAnyma->sendMessageNow( MidiMessage( data, numBytes, 0 ) );
+  }
+};
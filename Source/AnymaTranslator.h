@@ -0,0 +1,138 @@
+/*
+  AnymaTranslator
+  Anyma system exclusive vocabulary and the SYSEX > CC mapping.
+  Shared by the standalone app (MidiProcessor) and the plugin (PluginProcessor)
+  so both translate identically. No ports, no threads, no allocation.
+*/
+
+#pragma once
+
+#ifndef JUCE_AUDIO_BASICS_H_INCLUDED // plugin build brings its own JuceHeader
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+
+namespace AnymaSyx
+{
+  // system exclusive messages to anyma hardware
+  const uint8_t keepAlive[3] = { 0xF0, 0x71, 0xF7 }; // 'q'
+  const uint8_t getStatus[5] = { 0xF0, 0x71, 0x62, 0x06, 0xF7 }; // 'qb' 6
+  const uint8_t eMode[7] = { 0xF0, 0x00, 0x21, 0x33, 0x71, 0x00, 0xF7 }; // 0 '!3q' 0
+  const uint8_t patch[7] = { 0xF0, 0x00, 0x21, 0x33, 0x71, 0x11, 0xF7 }; // 0 '!3q' 11
+
+  const int patchDumpMinSize = 256; // sysex data size of a patch dump
+
+  // raw variants (incl 0xF0 and 0xF7 terminator) for use without a MidiMessage
+  inline bool isSysEx( const uint8_t* raw, const int numBytes )
+  { return raw != nullptr && numBytes >= 2 && raw[0] == 0xF0; }
+
+  inline bool isPatchDump( const uint8_t* raw, const int numBytes )
+  { return isSysEx( raw, numBytes ) && numBytes - 2 >= patchDumpMinSize; }
+
+  inline bool isParamState( const uint8_t* raw, const int numBytes )
+  { return isSysEx( raw, numBytes ) && numBytes - 2 < patchDumpMinSize; }
+
+  inline bool isPatchDump( const juce::MidiMessage& message )
+  { return message.getSysExDataSize() >= patchDumpMinSize; }
+
+  inline bool isParamState( const juce::MidiMessage& message )
+  { return message.isSysEx() && message.getSysExDataSize() < patchDumpMinSize; }
+}
+
+class AnymaTranslator
+{
+public:
+  /** examine rx param state (incl 0xF0 and 0xF7 terminator) and build the
+      equivalent MIDI CC. returns false if rx carries nothing we map. */
+  static bool toCC( const uint8_t* rx, const int numBytes, juce::MidiMessage& cc )
+  {
+    if( ! AnymaSyx::isParamState( rx, numBytes ) ) return false;
+    if( numBytes < 5 ) return false; // F0 71 group param value
+
+    return handleTuning( rx, cc )
+        || handleMainMatrix( rx, cc )
+        || handleAltMatrix( rx, cc );
+  }
+
+  static bool toCC( const juce::MidiMessage& message, juce::MidiMessage& cc )
+  {
+    if( ! AnymaSyx::isParamState( message ) ) return false;
+    return toCC( message.getRawData(), message.getRawDataSize(), cc );
+  }
+
+private:
+  // cc 23
+  static bool handleTuning( const uint8_t* rx, juce::MidiMessage& cc )
+  {
+    if( 0xF0 == rx[0] &&
+        0x71 == rx[1] &&
+        0x00 == rx[2] && // 0x00 = system param
+        0x02 == rx[3] )  // 0x02 = tuning
+    {
+        // cc 23 from param 2
+        cc = juce::MidiMessage::controllerEvent( 1, 23, rx[4] );
+        return true;
+    }
+    return false;
+  }
+
+  // cc 16-31 (omit 23)
+  static bool handleMainMatrix( const uint8_t* rx, juce::MidiMessage& cc )
+  {
+    if( 0xF0 == rx[0] &&
+        0x71 == rx[1] &&
+        0x06 == rx[2] )  // 0x06 = main matrix
+    {
+      // cc 16-22 from p 0-6
+      if( rx[3] <= 6 )
+      {
+        cc = juce::MidiMessage::controllerEvent( 1, rx[3] + 16, rx[4] );
+        return true;
+      }
+
+      // cc 23 'main tuning' handled elsewhere
+
+      // cc 24-31 from p 7-14
+      if( rx[3] >= 7 && rx[3] <= 14 )
+      {
+        cc = juce::MidiMessage::controllerEvent( 1, rx[3] + 17, rx[4] );
+        return true;
+      }
+    }// is main matrix?
+    return false;
+  }
+
+  // cc 102-117 (omit 109, 114)
+  static bool handleAltMatrix( const uint8_t* rx, juce::MidiMessage& cc )
+  {
+    if( 0xF0 == rx[0] &&
+        0x71 == rx[1] &&
+        0x07 == rx[2] )  // 0x07 = alt matrix
+    {
+      // cc 102-108 from p 0-6
+      if( rx[3] <= 6 )
+      {
+        cc = juce::MidiMessage::controllerEvent( 1, rx[3] + 102, rx[4] );
+        return true;
+      }
+
+      // cc 109 - 'alt tuning' handled elsewhere
+
+      // cc 110-113 from p 7-10
+      if( rx[3] >= 7 && rx[3] <= 10 )
+      {
+        cc = juce::MidiMessage::controllerEvent( 1, rx[3] + 103, rx[4] );
+        return true;
+      }
+
+      // cc 114 - 'alt morph' handled elsewhere
+
+      // cc 115-117 from p 11-13
+      if( rx[3] >= 11 && rx[3] <= 13 )
+      {
+        cc = juce::MidiMessage::controllerEvent( 1, rx[3] + 104, rx[4] );
+        return true;
+      }
+    }// is alt matrix?
+    return false;
+  }
+};
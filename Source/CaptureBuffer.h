@@ -0,0 +1,199 @@
+/*
+  CaptureBuffer
+  Always-on ring of the most recent MIDI sent to the sequencer, with timestamps.
+  Written wait-free from the midi thread, read on the message thread to export
+  the last N seconds as a standard MIDI file ("retrospective capture").
+  Fixed memory, allocated once, oldest events are overwritten.
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include <atomic>
+
+//
+class CaptureBuffer
+{
+public:
+  enum
+  {
+    maxEvents = 1 << 16,        // cc and sysex, ~11 min of busy knob twiddling
+    maxSysExBytes = 1 << 20,    // patch dumps and other forwarded sysex
+    maxSysExMessage = 1 << 16   // larger messages are not captured
+  };
+
+private:
+  // every field is a relaxed atomic, so a reader racing the writer sees
+  // stale or new values, never undefined ones. seqlock style counters
+  // below tell the reader which of its copies it may keep
+  struct Event
+  {
+    std::atomic<double> time;        // seconds, juce::Time::getMillisecondCounterHiRes() based
+    std::atomic<juce::uint64> pos;   // absolute offset into syxRing, sysex only
+    std::atomic<int> numBytes;
+    std::atomic<juce::uint32> bytes; // short messages live here, little end first
+  };
+
+  // zero filled memory is a valid zero for these lock free atomics
+  juce::HeapBlock<Event> events;                  // ring, index & (maxEvents - 1)
+  juce::HeapBlock<std::atomic<uint8_t> > syxRing; // ring, offset & (maxSysExBytes - 1)
+
+  // single writer (midi thread). claimed counters move before a slot or
+  // byte range is overwritten, written counters after it is complete
+  std::atomic<juce::uint64> eventsClaimed { 0 };
+  std::atomic<juce::uint64> eventsWritten { 0 };
+  std::atomic<juce::uint64> syxClaimed { 0 };
+  std::atomic<juce::uint64> syxWritten { 0 };
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CaptureBuffer)
+
+public:
+  CaptureBuffer()
+  {
+    events.calloc( maxEvents );
+    syxRing.calloc( maxSysExBytes );
+  }
+
+  static double now() { return juce::Time::getMillisecondCounterHiRes() * 0.001; }
+
+  static size_t getMemoryUsage()
+  { return sizeof (Event) * maxEvents + sizeof (std::atomic<uint8_t>) * maxSysExBytes; }
+
+#pragma mark midi thread
+  /** record a message sent to the sequencer. wait-free, no allocation, no locks.
+      call from one thread only. */
+  void push( const juce::MidiMessage& message )
+  {
+    const uint8_t* raw = message.getRawData();
+    const int numBytes = message.getRawDataSize();
+    if( numBytes <= 0 || numBytes > maxSysExMessage ) return;
+
+    const bool isLong = numBytes > (int) sizeof (juce::uint32);
+    const juce::uint64 w = eventsWritten.load( std::memory_order_relaxed );
+    const juce::uint64 p = syxWritten.load( std::memory_order_relaxed );
+
+    // announce the overwrite before making it, the fence keeps the claims
+    // ahead of every store below for a reader that fences after its copy
+    eventsClaimed.store( w + 1, std::memory_order_relaxed );
+    if( isLong ) syxClaimed.store( p + (juce::uint64) numBytes, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    Event& e = events[ (int) (w & (maxEvents - 1)) ];
+    e.time.store( now(), std::memory_order_relaxed );
+    e.numBytes.store( numBytes, std::memory_order_relaxed );
+
+    if( ! isLong )
+    {
+      juce::uint32 packed = 0;
+      for( int i = 0; i < numBytes; ++i ) packed |= (juce::uint32) raw[i] << (8 * i);
+      e.bytes.store( packed, std::memory_order_relaxed );
+    }
+    else
+    {
+      for( int i = 0; i < numBytes; ++i )
+        syxRing[ (int) ((p + (juce::uint64) i) & (maxSysExBytes - 1)) ].store( raw[i], std::memory_order_relaxed );
+
+      e.pos.store( p, std::memory_order_relaxed );
+      syxWritten.store( p + (juce::uint64) numBytes, std::memory_order_release );
+    }
+
+    eventsWritten.store( w + 1, std::memory_order_release );
+  }
+
+#pragma mark message thread
+  /** copy events newer than (now - seconds) into sequence, timestamps in
+      seconds from the start of the window. returns number of events copied */
+  int copyRecent( const double seconds, juce::MidiMessageSequence& sequence ) const
+  {
+    const double windowStart = now() - seconds;
+    const juce::uint64 w = eventsWritten.load( std::memory_order_acquire );
+    const juce::uint64 first = (w > (juce::uint64) maxEvents) ? w - maxEvents : 0;
+
+    juce::HeapBlock<uint8_t> scratch( maxSysExMessage );
+    int numCopied = 0;
+
+    for( juce::uint64 i = first; i < w; ++i )
+    {
+      const Event& e = events[ (int) (i & (maxEvents - 1)) ];
+      const double time = e.time.load( std::memory_order_relaxed );
+      const int numBytes = e.numBytes.load( std::memory_order_relaxed );
+      const bool isLong = numBytes > (int) sizeof (juce::uint32);
+      juce::uint64 pos = 0;
+
+      if( numBytes <= 0 || numBytes > maxSysExMessage ) continue; // torn, rechecked below anyway
+
+      if( isLong )
+      {
+        pos = e.pos.load( std::memory_order_relaxed );
+        for( int b = 0; b < numBytes; ++b )
+          scratch[b] = syxRing[ (int) ((pos + (juce::uint64) b) & (maxSysExBytes - 1)) ].load( std::memory_order_relaxed );
+      }
+      else
+      {
+        const juce::uint32 packed = e.bytes.load( std::memory_order_relaxed );
+        for( int b = 0; b < numBytes; ++b ) scratch[b] = (uint8_t) (packed >> (8 * b));
+      }
+
+      // pairs with the writer's release fence: if any value copied above is
+      // from a newer overwrite, the claims loaded below show that overwrite
+      std::atomic_thread_fence( std::memory_order_acquire );
+
+      // slot i is reused by event i + maxEvents, claimed as i + maxEvents + 1
+      if( eventsClaimed.load( std::memory_order_relaxed ) > i + maxEvents ) continue;
+
+      // bytes at pos are reused once the claim passes pos + maxSysExBytes
+      if( isLong && syxClaimed.load( std::memory_order_relaxed ) > pos + maxSysExBytes ) continue;
+
+      if( time < windowStart ) continue;
+
+      sequence.addEvent( juce::MidiMessage( scratch, numBytes, time - windowStart ) );
+      ++numCopied;
+    }
+
+    return numCopied;
+  }
+
+  /** seconds between the oldest event still held and now */
+  double getHeldSeconds() const
+  {
+    const juce::uint64 w = eventsWritten.load( std::memory_order_acquire );
+    if( w == 0 ) return 0.0;
+
+    const juce::uint64 first = (w > (juce::uint64) maxEvents) ? w - maxEvents + 1 : 0;
+    return now() - events[ (int) (first & (maxEvents - 1)) ].time.load( std::memory_order_relaxed );
+  }
+
+  /** write the last seconds to a type 1 standard MIDI file at 120 bpm.
+      returns number of events written, -1 on failure */
+  int exportMidiFile( const double seconds, const juce::File& file ) const
+  {
+    const int ticksPerQuarterNote = 960;
+    const double ticksPerSecond = ticksPerQuarterNote * 2.0; // 120 bpm
+
+    juce::MidiMessageSequence captured;
+    const int numEvents = copyRecent( seconds, captured );
+
+    juce::MidiMessageSequence track;
+    track.addEvent( juce::MidiMessage::tempoMetaEvent( 500000 ), 0 ); // 120 bpm
+    for( int i = 0; i < captured.getNumEvents(); ++i )
+    {
+      juce::MidiMessage m = captured.getEventPointer( i )->message;
+      m.setTimeStamp( juce::roundToInt( m.getTimeStamp() * ticksPerSecond ) );
+      track.addEvent( m );
+    }
+    track.updateMatchedPairs();
+
+    juce::MidiFile midiFile;
+    midiFile.setTicksPerQuarterNote( ticksPerQuarterNote );
+    midiFile.addTrack( track );
+
+    file.getParentDirectory().createDirectory();
+    file.deleteFile();
+    juce::FileOutputStream out( file );
+    if( out.failedToOpen() ) return -1;
+    if( ! midiFile.writeTo( out ) ) return -1;
+
+    return numEvents;
+  }
+};
@@ -0,0 +1,152 @@
+/*
+  CaptureBufferTest
+  One writer thread pushes numbered CC and sysex of varying length while the
+  test copies the ring again and again: every copied event must be intact,
+  in order, with both the event ring and the sysex ring wrapping many times.
+  Run with: AnymaPal --unit-tests
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include "CaptureBuffer.h"
+
+class CaptureBufferTest : public juce::UnitTest
+{
+private:
+  // ~4.5 laps of the event ring, ~20 laps of the sysex ring
+  enum { numPushes = 300000, sysexEvery = 5, maxPattern = 600 };
+
+  // event k: sysex carrying k and a pattern derived from it, or a CC whose
+  // second data byte is a checksum of the first
+  static juce::MidiMessage makeEvent( const int k )
+  {
+    if( k % sysexEvery != 0 )
+    {
+      const int number = k & 0x7F;
+      return juce::MidiMessage::controllerEvent( 1, number, checksum( number ) );
+    }
+
+    const int numBytes = getSysExSize( k );
+    juce::HeapBlock<uint8_t> raw( (size_t) numBytes );
+    raw[0] = 0xF0;
+    raw[1] = (uint8_t) ((k >> 21) & 0x7F);
+    raw[2] = (uint8_t) ((k >> 14) & 0x7F);
+    raw[3] = (uint8_t) ((k >> 7) & 0x7F);
+    raw[4] = (uint8_t) (k & 0x7F);
+    for( int j = 5; j < numBytes - 1; ++j ) raw[j] = (uint8_t) ((k + j) & 0x7F);
+    raw[numBytes - 1] = 0xF7;
+    return juce::MidiMessage( raw, numBytes, 0 );
+  }
+
+  static int checksum( const int number ) { return (number * 37 + 11) & 0x7F; }
+  static int getSysExSize( const int k ) { return 7 + (k % maxPattern) * 7919 % maxPattern; }
+
+  /** returns k for an intact sysex, -1 for an intact CC, -2 if torn */
+  static int checkEvent( const juce::MidiMessage& m )
+  {
+    const uint8_t* raw = m.getRawData();
+    const int numBytes = m.getRawDataSize();
+
+    if( numBytes == 3 && raw[0] == 0xB0 )
+      return (raw[2] == checksum( raw[1] )) ? -1 : -2;
+
+    if( numBytes < 7 || raw[0] != 0xF0 || raw[numBytes - 1] != 0xF7 ) return -2;
+
+    const int k = (raw[1] << 21) | (raw[2] << 14) | (raw[3] << 7) | raw[4];
+    if( k % sysexEvery != 0 || numBytes != getSysExSize( k ) ) return -2;
+    for( int j = 5; j < numBytes - 1; ++j )
+      if( raw[j] != ((k + j) & 0x7F) ) return -2;
+
+    return k;
+  }
+
+  // the midi thread
+  class Writer : public juce::Thread
+  {
+  public:
+    CaptureBuffer& buffer;
+    Writer( CaptureBuffer& captureBuffer ) : juce::Thread( "CaptureBufferTest writer" ), buffer( captureBuffer ) {}
+
+    void run() override
+    {
+      for( int k = 0; k < numPushes; ++k )
+      {
+        buffer.push( makeEvent( k ) );
+        if( k % 1000 == 0 ) sleep( 1 ); // give the reader time to race us
+      }
+    }
+  };
+
+  /** copy everything held and check it, returns number of events copied */
+  int copyAndCheck( const CaptureBuffer& buffer, int& lastSysEx )
+  {
+    juce::MidiMessageSequence copied;
+    const int numCopied = buffer.copyRecent( 1.0e9, copied );
+    expectEquals( copied.getNumEvents(), numCopied );
+
+    int previousSysEx = -1;
+    double previousTime = 0.0;
+    for( int i = 0; i < copied.getNumEvents(); ++i )
+    {
+      const juce::MidiMessage& m = copied.getEventPointer( i )->message;
+      const int k = checkEvent( m );
+      expect( k != -2, "torn event" );
+
+      expect( m.getTimeStamp() >= previousTime, "events out of time order" );
+      previousTime = m.getTimeStamp();
+
+      if( k >= 0 )
+      {
+        expect( k > previousSysEx, "sysex out of order" );
+        previousSysEx = k;
+      }
+    }
+
+    lastSysEx = previousSysEx;
+    return numCopied;
+  }
+
+public:
+  CaptureBufferTest() : juce::UnitTest( "CaptureBuffer" ) {}
+
+  void runTest() override
+  {
+    juce::ScopedPointer<CaptureBuffer> buffer = new CaptureBuffer();
+    int lastSysEx = -1;
+
+    beginTest( "copies while the writer laps both rings are intact" );
+    {
+      Writer writer( *buffer );
+      writer.startThread();
+
+      int numCopies = 0;
+      while( writer.isThreadRunning() )
+      {
+        copyAndCheck( *buffer, lastSysEx );
+        ++numCopies;
+      }
+      writer.waitForThreadToExit( -1 );
+      logMessage( "copies taken while writing: " + juce::String( numCopies ) );
+    }
+
+    beginTest( "after wrapping, the newest events are all held" );
+    {
+      const int numCopied = copyAndCheck( *buffer, lastSysEx );
+      const int lastK = numPushes - 1;
+
+      // every event slot is in use, only sysex whose bytes were overwritten drop out
+      expect( numCopied > CaptureBuffer::maxEvents / 2, "too few events held" );
+      expect( numCopied <= CaptureBuffer::maxEvents, "more events than slots" );
+      expectEquals( lastSysEx, lastK - lastK % sysexEvery );
+    }
+
+    beginTest( "a short window holds only recent events" );
+    {
+      juce::MidiMessageSequence none;
+      juce::Thread::sleep( 20 );
+      expectEquals( buffer->copyRecent( 0.001, none ), 0 );
+    }
+  }
+};
+
+static CaptureBufferTest captureBufferTest;
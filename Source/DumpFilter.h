@@ -0,0 +1,51 @@
+/*
+  DumpFilter
+  Content hash of a patch dump, and the "only changed patch dumps" decision.
+  Hash and compare only, no i/o, no allocation: safe on the midi thread and
+  in the plugin's processBlock. Shared by PatchLibrary and PluginProcessor.
+*/
+
+#pragma once
+
+#ifndef JUCE_AUDIO_BASICS_H_INCLUDED // plugin build brings its own JuceHeader
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
+
+#include <atomic>
+
+//
+class DumpFilter
+{
+public:
+  typedef juce::uint64 Hash;
+
+private:
+  std::atomic<bool> forwardOnlyChanged { true }; // set from the ui, read on the midi thread
+  Hash lastForwarded = 0; // midi thread only, 0 means nothing forwarded yet
+
+public:
+  /** 64 bit FNV-1a over the whole dump, incl 0xF0 and 0xF7 terminator */
+  static Hash hashDump( const uint8_t* raw, const int numBytes )
+  {
+    Hash h = 14695981039346656037ULL;
+    for( int i = 0; i < numBytes; ++i )
+    {
+      h ^= raw[i];
+      h *= 1099511628211ULL;
+    }
+    return h ? h : 1; // keep 0 free for "no hash"
+  }
+
+  /** forward every dump, or only dumps whose content differs from the last
+      one forwarded (default) so repeated takes of one patch tx no sysex */
+  void setForwardOnlyChanged( const bool onlyChanged ) { forwardOnlyChanged = onlyChanged; }
+  bool isForwardOnlyChanged() const { return forwardOnlyChanged; }
+
+  /** true if the dump should go to the sequencer, remembers it if so */
+  bool isForwardRequired( const Hash hash )
+  {
+    if( forwardOnlyChanged && hash == lastForwarded ) return false;
+    lastForwarded = hash;
+    return true;
+  }
+};
@@ -43,9 +43,29 @@ public:
 
     void initialise (const String& commandLine) override
     {
+        if (commandLine.contains ("--unit-tests"))
+        {
+            runUnitTests();
+            return;
+        }
+
         mainWindow = new MainWindow (getApplicationName());
     }
 
+    // AnymaPal --unit-tests, exit code is the number of failures
+    void runUnitTests()
+    {
+        UnitTestRunner runner;
+        runner.runAllTests();
+
+        int numFailures = 0;
+        for (int i = 0; i < runner.getNumResults(); ++i)
+            numFailures += runner.getResult (i)->failures;
+
+        setApplicationReturnValue (numFailures);
+        quit();
+    }
+
     void shutdown() override
     {
         mainWindow = nullptr;
@@ -1,11 +1,16 @@
 /*
-  MidiProcessor          - logic, MIDI tx and rx
+  MidiProcessor          - standalone MIDI tx and rx, translation in AnymaTranslator,
+                           anyma start/stop in AnymaSession
   MidiProcessorComponent - juce user interface
 */
 
 #include "../JuceLibraryCode/JuceHeader.h"
 
-#include "SyxRepeater.h"
+#include "AnymaSession.h"
+#include "AnymaTranslator.h"
+#include "PatchLibrary.h"
+#include "CaptureBuffer.h"
+#include "PatchBank.h"
 
 class MainContentComponent; // fwd declaration
 
@@ -13,15 +18,11 @@ class MidiProcessor
       : private juce::MidiInputCallback
 {
 private:
-  // system exclusive messages to anyma hardware
-  const uint8_t keepAliveSyx[3] = { 0xF0, 0x71, 0xF7 }; // 'q'
-  const uint8_t getStatusSyx[5] = { 0xF0, 0x71, 0x62, 0x06, 0xF7 }; // 'qb' 6
-  const uint8_t eModeSyx[7] = { 0xF0, 0x00, 0x21, 0x33, 0x71, 0x00, 0xF7 }; // 0 '!3q' 0
-  const uint8_t patchSyx[7] = { 0xF0, 0x00, 0x21, 0x33, 0x71, 0x11, 0xF7 }; // 0 '!3q' 11
-
-  // regularly TX to anyma hardware
-  SyxRepeater anymaKeepAlive;
-  SyxRepeater anymaGetStatus;
+  // every unique patch dump we have seen, by hash
+  PatchLibrary patchLibrary;
+
+  // everything sent to the sequencer, recent minutes, for retrospective capture
+  CaptureBuffer captureBuffer;
   
   int fromAnymaIndex = 0; // index of juce::MidiInput device
   juce::AudioDeviceManager deviceManager;
@@ -29,14 +30,12 @@ private:
   juce::ScopedPointer<juce::MidiOutput> midiToSequencer;
   juce::ScopedPointer<juce::MidiOutput> midiToAnyma;
 
+  // patch requests, editor mode and status updates to anyma hardware
+  AnymaSession session;
+
 public:
   MidiProcessor()
   {
-    anymaKeepAlive.setMsg( keepAliveSyx, 3 );
-    anymaKeepAlive.setInterval( 1000 );
-    
-    anymaGetStatus.setMsg( getStatusSyx, 5 );
-    anymaGetStatus.setInterval( 200 );
   }
   
   ~MidiProcessor()
@@ -44,150 +43,57 @@ public:
   }
 
 #pragma enable/disable processing
-  void start()
+  void start(){ session.start(); }
+  void stop(){ session.stop(); }
+  bool isActive(){ return session.isActive(); }
+  void toggle(){ session.toggle(); }
+
+#pragma patch library
+  PatchLibrary& getPatchLibrary(){ return patchLibrary; }
+
+  // tx a stored patch dump to the anyma hardware
+  bool recallPatch( const PatchLibrary::Hash hash )
   {
-    // request the anyma hardware send us the current patch state
-    midiToAnyma->sendMessageNow( MidiMessage( patchSyx, 7, 0 ) );
-    
-    // begin anyma editor mode and request regular updates
-    Thread::sleep( 1000 ); // kludgey delay to allow patch dump to complete
-    midiToAnyma->sendMessageNow( MidiMessage( eModeSyx, 7, 0 ) );
-    anymaKeepAlive.start();
-    anymaGetStatus.start();
+    if( midiToAnyma == nullptr ) return false;
+    return patchLibrary.recall( hash, *midiToAnyma );
   }
-  
-  void stop()
+
+#pragma retrospective capture
+  const CaptureBuffer& getCaptureBuffer(){ return captureBuffer; }
+
+  // write the last seconds sent to the sequencer to a MIDI file
+  int captureLast( const double seconds, const juce::File& file )
   {
-    // cease transmision of editor status requests
-    anymaKeepAlive.stop();
-    anymaGetStatus.stop();
-    
-    // request the anyma hardware send us the current patch state
-    // kludgey delay to allow state to change
-    Thread::sleep( 5000 );
-    midiToAnyma->sendMessageNow( MidiMessage( patchSyx, 7, 0 ) );
+    return captureBuffer.exportMidiFile( seconds, file );
   }
-  
-  bool isActive(){ return anymaKeepAlive.isActive(); }
-  void toggle(){ isActive() ? stop() : start(); }
 
 #pragma midi tx and rx
   void handleIncomingMidiMessage (juce::MidiInput* source, const juce::MidiMessage& message) override
   {
       // DBG( "incomingMIDI " + String( message.getRawDataSize() ) );
+      if( midiToSequencer == nullptr ) return;
     
-      if ( message.getSysExDataSize() >= 256 ) // is sysex patchdump?
-      {
-        midiToSequencer->sendMessageNow( message ); // forward to sequencer
-      }
-
-      if( message.isSysEx() && message.getSysExDataSize() < 256 ) // is sysex param state?
+      if ( AnymaSyx::isPatchDump( message ) ) // is sysex patchdump?
       {
-        const uint8_t* rx = message.getRawData(); // incl 0xF0 and 0xF7 terminator
+        const PatchLibrary::Hash hash = PatchLibrary::hashDump( message );
+        patchLibrary.queueStore( hash, message ); // written on the library's thread
         
-        // examine rx data and tx MIDI CC
-        handleTuning( rx );
-        handleMainMatrix( rx );
-        handleAltMatrix( rx );
+        if( patchLibrary.isForwardRequired( hash ) ) // unchanged since last take?
+          txToSequencer( message ); // forward to sequencer
       }
-    
-  }
-  
-  // tx cc 23
-  void handleTuning( const uint8_t* rx )
-  {
-    if( rx == nullptr ) return;
-    if( midiToSequencer == nullptr ) return;
-  
-    if( 0xF0 == rx[0] &&
-        0x71 == rx[1] &&
-        0x00 == rx[2] && // 0x00 = system param
-        0x02 == rx[3] )  // 0x02 = tuning
-    {
-        // cc 23 from param 2
-        MidiMessage msg = MidiMessage::controllerEvent( 1, 23, rx[4] );
-        midiToSequencer->sendMessageNow( msg );
-    }
-  }
 
-  // tx cc 16-31 (omit 23)
-  void handleMainMatrix( const uint8_t* rx )
-  {
-    if( rx == nullptr ) return;
-    if( midiToSequencer == nullptr ) return;
-    
-    if( 0xF0 == rx[0] &&
-        0x71 == rx[1] &&
-        0x06 == rx[2] )  // 0x06 = main matrix
-    {
-      // cc 16-22 from p 0-6
-      if( rx[3] >= 0 && rx[3] <= 6 )
-      {
-        uint8_t ccNum = rx[3] + 16;
-        uint8_t ccVal = rx[4];
-        
-        MidiMessage tx = MidiMessage::controllerEvent( 1, ccNum, ccVal );
-        midiToSequencer->sendMessageNow( tx );
-      }
-      
-      // cc 23 'main tuning' handled elsewhere
-      
-      // cc 24-31 from p 7-14
-      if( rx[3] >= 7 && rx[3] <= 14 )
+      // is sysex param state? examine rx data and tx MIDI CC
+      MidiMessage cc;
+      if( AnymaTranslator::toCC( message, cc ) )
       {
-        uint8_t ccNum = rx[3] + 17;
-        uint8_t ccVal = rx[4];
-
-        MidiMessage tx = MidiMessage::controllerEvent( 1, ccNum, ccVal );
-        midiToSequencer->sendMessageNow( tx );
+        txToSequencer( cc );
       }
-    }// is main matrix?
   }
-  
-  // tx cc 102-117 (omit 109, 114)
-  void handleAltMatrix( const uint8_t* rx )
+
+  void txToSequencer( const juce::MidiMessage& message )
   {
-    if( rx == nullptr ) return;
-    if( midiToSequencer == nullptr ) return;
-    
-    if( 0xF0 == rx[0] &&
-        0x71 == rx[1] &&
-        0x07 == rx[2] )  // 0x07 = alt matrix
-    {
-      // cc 102-108 from p 0-6
-      if( rx[3] >= 0 && rx[3] <= 6 )
-      {
-        uint8_t ccNum = rx[3] + 102;
-        uint8_t ccVal = rx[4];
-        
-        MidiMessage tx = MidiMessage::controllerEvent( 1, ccNum, ccVal );
-        midiToSequencer->sendMessageNow( tx );
-      }
-      
-      // cc 109 - 'alt tuning' handled elsewhere
-      
-      // cc 110-113 from p 7-10
-      if( rx[3] >= 7 && rx[3] <= 10 )
-      {
-        uint8_t ccNum = rx[3] + 103;
-        uint8_t ccVal = rx[4];
-        
-        MidiMessage tx = MidiMessage::controllerEvent( 1, ccNum, ccVal );
-        midiToSequencer->sendMessageNow( tx );
-      }
-      
-      // cc 114 - 'alt morph' handled elsewhere
-      
-      // cc 115-117 from p 11-13
-      if( rx[3] >= 11 && rx[3] <= 13 )
-      {
-        uint8_t ccNum = rx[3] + 104;
-        uint8_t ccVal = rx[4];
-        
-        MidiMessage tx = MidiMessage::controllerEvent( 1, ccNum, ccVal );
-        midiToSequencer->sendMessageNow( tx );
-      }
-    }// is alt matrix?
+    midiToSequencer->sendMessageNow( message );
+    captureBuffer.push( message ); // always on, wait-free
   }
 
 #pragma midi system ports
@@ -208,9 +114,9 @@ public:
 
   void setOutputToAnyma( const int index )
   {
+      session.setOutput( nullptr ); // before the old port closes
       midiToAnyma = juce::MidiOutput::openDevice( index );
-      anymaGetStatus.setOutput( midiToAnyma );
-      anymaKeepAlive.setOutput( midiToAnyma );
+      session.setOutput( midiToAnyma );
   }
   
   void setOutputToSequencer( String midiToSequencerDeviceName )
@@ -228,6 +134,8 @@ public:
 class MidiProcessorComponent
   : public juce::Component
   , private juce::ComboBox::Listener
+  , private juce::Button::Listener
+  , private juce::ChangeListener
 {
 private:
   juce::Label& uiLabel_mainStatus; // parent ref
@@ -245,6 +153,15 @@ private:
   juce::Label uiLabel_midiToAnyma;
   juce::Label uiLabel_midiToSequencer; // show virtual port name
   
+  juce::ToggleButton uiToggle_onlyChangedDumps; // skip repeated patch dumps
+  juce::ComboBox uiCombo_recallPatch; // choose stored patch to tx to anyma, or bank import/export
+  juce::Array<PatchLibrary::Hash> uiPatchHashes; // item id - 1 -> hash
+  enum { uiIdImportBank = 0x7fff0001, uiIdExportBank };
+  
+  juce::TextButton uiTextButton_capture; // save recent minutes as MIDI file
+  juce::ComboBox uiCombo_captureLength; // how many of those minutes, item id = seconds
+  enum { uiIdCaptureAllHeld = 0x7fff0001 };
+  
   juce::Label uiLabel_info; // "the problem, this solution"
   
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MidiProcessorComponent);
@@ -316,10 +233,42 @@ public:
     // user interface label
     addAndMakeVisible (uiLabel_midiToSequencer);
     uiLabel_midiToSequencer.setText ("To Sequencer: " + midiToSequencerDeviceName, juce::dontSendNotification);
+    
+    // //// ////  //// ////  //// ////  //// ////  //// ////  //// ////
+    // patch library
+    addAndMakeVisible (uiToggle_onlyChangedDumps);
+    uiToggle_onlyChangedDumps.setButtonText ("Only changed patch dumps");
+    uiToggle_onlyChangedDumps.setColour (juce::ToggleButton::ColourIds::textColourId, Colours::lightgrey);
+    uiToggle_onlyChangedDumps.setToggleState (procr.getPatchLibrary().isForwardOnlyChanged(), dontSendNotification);
+    uiToggle_onlyChangedDumps.addListener( this ); // buttonClicked
+    
+    addAndMakeVisible (uiCombo_recallPatch);
+    uiApplyComboColours (uiCombo_recallPatch, ComboType::OutputToAnyma);
+    uiCombo_recallPatch.addListener( this ); // comboBoxChanged
+    uiCombo_recallPatch.setTextWhenNothingSelected ("Recall patch...");
+    
+    procr.getPatchLibrary().addChangeListener( this ); // changeListenerCallback
+    uiRefreshPatchList();
+    
+    // //// ////  //// ////  //// ////  //// ////  //// ////  //// ////
+    // retrospective capture
+    addAndMakeVisible (uiCombo_captureLength);
+    uiApplyComboColours (uiCombo_captureLength, ComboType::OutputToSequencer);
+    uiCombo_captureLength.addItem ("Last 30s", 30);
+    uiCombo_captureLength.addItem ("Last 2 min", 120);
+    uiCombo_captureLength.addItem ("Last 5 min", 300);
+    uiCombo_captureLength.addItem ("All held", uiIdCaptureAllHeld);
+    uiCombo_captureLength.setSelectedId (120, dontSendNotification);
+    
+    addAndMakeVisible (uiTextButton_capture);
+    uiTextButton_capture.setButtonText ("Capture");
+    uiApplyTextButtonColours (uiTextButton_capture);
+    uiTextButton_capture.addListener( this ); // buttonClicked
   }
   
   ~MidiProcessorComponent()
   {
+    procr.getPatchLibrary().removeChangeListener( this );
   }
   
   //====================================================================
@@ -336,6 +285,20 @@ public:
   
     if( comboBoxThatHasChanged == &uiCombo_midiFromAnyma ) chooseMidiInput ( newIndex );
     if( comboBoxThatHasChanged == &uiCombo_midiToAnyma ) chooseMidiOutput ( newIndex );
+    if( comboBoxThatHasChanged == &uiCombo_recallPatch ) choosePatch ( uiCombo_recallPatch.getSelectedId() );
+  }
+
+  void buttonClicked( Button* buttonThatWasClicked ) override
+  {
+    if( buttonThatWasClicked == &uiToggle_onlyChangedDumps )
+      procr.getPatchLibrary().setForwardOnlyChanged( uiToggle_onlyChangedDumps.getToggleState() );
+    
+    if( buttonThatWasClicked == &uiTextButton_capture ) captureRecent();
+  }
+
+  void changeListenerCallback( ChangeBroadcaster* source ) override
+  {
+    if( source == &procr.getPatchLibrary() ) uiRefreshPatchList();
   }
 
   //==================================================================
@@ -351,6 +314,108 @@ public:
       procr.setOutputToAnyma( index );
       uiCombo_midiToAnyma.setSelectedId( index + 1, juce::dontSendNotification );
   }
+
+  void captureRecent()
+  {
+      File file = File::getSpecialLocation( File::userDocumentsDirectory )
+                    .getChildFile( "AnymaPal" )
+                    .getChildFile( "capture " + Time::getCurrentTime().formatted( "%Y-%m-%d %H-%M-%S" ) + ".mid" );
+    
+      const int lengthId = uiCombo_captureLength.getSelectedId();
+      double seconds = (double) lengthId;
+      if( lengthId == uiIdCaptureAllHeld ) seconds = procr.getCaptureBuffer().getHeldSeconds() + 1.0;
+    
+      int numEvents = procr.captureLast( seconds, file );
+      String bufferInfo = String( CaptureBuffer::getMemoryUsage() / 1048576.0, 1 ) + "MB, "
+                        + String( procr.getCaptureBuffer().getHeldSeconds() / 60.0, 1 ) + " min held";
+    
+      if( numEvents < 0 )
+        uiLabel_mainStatus.setText( "Capture failed", dontSendNotification );
+      else
+        uiLabel_mainStatus.setText( "Captured " + String( numEvents ) + " (" + bufferInfo + ")", dontSendNotification );
+  }
+
+  void choosePatch( int itemId )
+  {
+      // nothing stays selected, so the same item may be chosen again
+      uiCombo_recallPatch.setSelectedId( 0, juce::dontSendNotification );
+
+      if( itemId == uiIdImportBank ) { importBanks(); return; }
+      if( itemId == uiIdExportBank ) { exportBank(); return; }
+
+      const int index = itemId - 1;
+      if( index >= 0 && index < uiPatchHashes.size() )
+      {
+        if( ! procr.recallPatch( uiPatchHashes[index] ) )
+          uiLabel_mainStatus.setText( "Recall failed", dontSendNotification );
+      }
+  }
+
+  void importBanks()
+  {
+      FileChooser chooser( "Import .syx or decoded .bin banks", File::nonexistent, "*.syx;*.bin" );
+      if( ! chooser.browseForMultipleFilesToOpen() ) return;
+
+      BankThread import( "Importing banks", chooser.getResults(), procr.getPatchLibrary(), false );
+      import.runThread();
+
+      // a cancelled import keeps (and reports) what it filed before stopping
+      String text = String( import.result.numNew ) + " new of " + String( import.result.numDumps )
+                  + ", " + String( import.result.numInvalid ) + " bad";
+      if( import.result.wasCancelled ) text = "Cancelled, " + text;
+      if( import.result.numFailed > 0 ) text << ", " << import.result.numFailed << " unwritten";
+      uiLabel_mainStatus.setText( text + ", " + String( import.elapsedMs, 0 ) + "ms", dontSendNotification );
+  }
+
+  void exportBank()
+  {
+      FileChooser chooser( "Export patch library as .syx bank or decoded .bin bank", File::nonexistent, "*.syx;*.bin" );
+      if( ! chooser.browseForFileToSave( true ) ) return;
+
+      Array<File> files;
+      files.add( chooser.getResult() );
+      BankThread exporter( "Exporting bank", files, procr.getPatchLibrary(), true );
+      const bool wasCancelled = ! exporter.runThread();
+
+      if( exporter.numExported < 0 ) // a cancelled export leaves no file behind
+        uiLabel_mainStatus.setText( wasCancelled ? "Export cancelled" : "Export failed", dontSendNotification );
+      else
+        uiLabel_mainStatus.setText( "Exported " + String( exporter.numExported ) + ", "
+                                    + String( exporter.elapsedMs, 0 ) + "ms", dontSendNotification );
+  }
+
+  // bank import (several files) or export (one file) off the message thread
+  class BankThread : public juce::ThreadWithProgressWindow
+                   , private PatchBank::Progress
+  {
+  public:
+    juce::Array<juce::File> files;
+    PatchLibrary& library;
+    const bool isExport;
+
+    PatchBank::Result result;
+    int numExported = -1;
+    double elapsedMs = 0.0;
+
+    BankThread( const String& title, const juce::Array<juce::File>& bankFiles, PatchLibrary& patchLibrary,
+                const bool exportToFile )
+      : juce::ThreadWithProgressWindow( title, true, true ),
+        files( bankFiles ), library( patchLibrary ), isExport( exportToFile )
+    {}
+
+    void run() override
+    {
+      double startMs = Time::getMillisecondCounterHiRes();
+      if( isExport ) numExported = PatchBank::exportBank( files.getFirst(), library, this );
+      else result = PatchBank::importBanks( files, library, this );
+      elapsedMs = Time::getMillisecondCounterHiRes() - startMs;
+    }
+
+  private:
+    // PatchBank::Progress, polled from run()
+    bool isCancelled() override { return threadShouldExit(); }
+    void setProportionDone( double proportion ) override { setProgress( proportion ); }
+  };
   
   //================================================================
 #pragma mark ui related
@@ -392,6 +457,20 @@ public:
     uiTextButton.setColour(juce::TextButton::ColourIds::textColourOffId, Colours::darkred);
   }
   
+  /** stored patch hashes */
+  void uiRefreshPatchList()
+  {
+      uiPatchHashes = procr.getPatchLibrary().getHashes();
+
+      uiCombo_recallPatch.clear( juce::dontSendNotification );
+      for( int i = 0; i < uiPatchHashes.size(); ++i )
+          uiCombo_recallPatch.addItem( PatchLibrary::toString( uiPatchHashes[i] ), i + 1 );
+
+      uiCombo_recallPatch.addSeparator();
+      uiCombo_recallPatch.addItem( "Import bank...", uiIdImportBank );
+      uiCombo_recallPatch.addItem( "Export bank...", uiIdExportBank );
+  }
+  
   /** input device names */
   juce::StringArray uiRefreshMidiInputList( int index, juce::String preferredName )
   {
@@ -455,11 +534,15 @@ public:
     
       area.setTop( uiCombo_midiToAnyma.getBottom() + padHeight );
       uiLabel_midiToSequencer.setBounds( area.removeFromTop(36).reduced(4) );
+      uiToggle_onlyChangedDumps.setBounds( area.removeFromTop(24) );
+      uiCombo_recallPatch.setBounds( area.removeFromTop( uiCombo_midiToAnyma.getHeight() ) );
     
       // horizontal one third
       area = initialarea
              .withLeft( 2 * initialarea.getWidth() / 3 )
              .withWidth( initialarea.getWidth() / 3 );
-      uiLabel_info.setBounds( area.withTrimmedBottom( 36 ) );
+      uiLabel_info.setBounds( area.withTrimmedBottom( 64 ) );
+      uiTextButton_capture.setBounds( area.removeFromBottom( 36 ).reduced( 4 ) );
+      uiCombo_captureLength.setBounds( area.removeFromBottom( 28 ).reduced( 4, 2 ) );
   }
 };
@@ -0,0 +1,330 @@
+/*
+  PatchBank
+  Bulk import/export of patch banks, in two formats:
+  .syx - anyma patch dumps back to back, 7 bit packed as sent over MIDI
+  .bin - decoded bank, "APb8" then per patch: uint32 length (little endian),
+         dump command byte, 8 bit payload. For tools that edit patch data.
+  Import splits every file, then decodes/encodes, validates and writes the
+  dumps in parallel chunks on a ThreadPool, and indexes them in one batch.
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include "AnymaTranslator.h"
+#include "PatchLibrary.h"
+#include "SyxPacking.h"
+
+//
+class PatchBank
+{
+public:
+  struct Result
+  {
+    int numFiles = 0;   // bank files read
+    int numDumps = 0;   // valid patch dumps found
+    int numInvalid = 0; // patches rejected by decodeDump
+    int numNew = 0;     // dumps not already in the library
+    int numFailed = 0;  // new dumps that could not be written
+    bool wasCancelled = false;
+  };
+
+  /** lets a caller (progress window) follow and stop an import or export */
+  class Progress
+  {
+  public:
+    virtual ~Progress() {}
+    virtual bool isCancelled() = 0;
+    virtual void setProportionDone( double proportion ) = 0;
+  };
+
+  enum Format { syxBank, decodedBank };
+
+  // F0 00 '!3' 'q' <cmd> ... F7, 7 bit packed payload between header and F7
+  static const int dumpHeaderSize = 6;
+
+  static const char* getDecodedMagic() { return "APb8"; }
+
+  static Format getFormat( const juce::File& file )
+  { return file.hasFileExtension( "bin" ) ? decodedBank : syxBank; }
+
+#pragma mark conversion
+  /** validates a sysex dump and unpacks its payload to 8 bit, into the start
+      of decoded (which also serves as scratch, reuse it between calls).
+      valid means framing, anyma header, 7 bit safe bytes, and a payload that
+      repacks to exactly itself. returns payload size, -1 if invalid */
+  static int decodeDump( const uint8_t* raw, const int numBytes, juce::MemoryBlock& decoded )
+  {
+    if( ! AnymaSyx::isPatchDump( raw, numBytes ) ) return -1;
+    if( raw[numBytes - 1] != 0xF7 ) return -1;
+    if( raw[1] != 0x00 || raw[2] != 0x21 || raw[3] != 0x33 || raw[4] != 0x71 ) return -1;
+
+    const uint8_t* packed = raw + dumpHeaderSize;
+    const int numPacked = numBytes - dumpHeaderSize - 1;
+    for( int i = 0; i < numPacked; ++i )
+      if( packed[i] & 0x80 ) return -1;
+
+    const int numUnpacked = SyxPacking::getUnpackedSize( numPacked );
+    decoded.ensureSize( (size_t) (numUnpacked + numPacked) );
+    uint8_t* unpacked = (uint8_t*) decoded.getData();
+    uint8_t* repacked = unpacked + numUnpacked;
+
+    SyxPacking::unpack( packed, numPacked, unpacked );
+
+    // lossless round trip, so stray bits in a short final group are caught too
+    if( SyxPacking::repack( unpacked, numUnpacked, repacked ) != numPacked ) return -1;
+    if( memcmp( repacked, packed, (size_t) numPacked ) != 0 ) return -1;
+
+    return numUnpacked;
+  }
+
+  /** builds the sysex dump for a decoded payload. false if it is no patch dump */
+  static bool encodeDump( const uint8_t command, const uint8_t* payload, const int numPayload,
+                          juce::MemoryBlock& dump )
+  {
+    const int numPacked = SyxPacking::getPackedSize( numPayload );
+    dump.setSize( (size_t) (dumpHeaderSize + numPacked + 1) );
+
+    uint8_t* raw = (uint8_t*) dump.getData();
+    const uint8_t header[dumpHeaderSize] = { 0xF0, 0x00, 0x21, 0x33, 0x71, (uint8_t) (command & 0x7F) };
+    memcpy( raw, header, dumpHeaderSize );
+    SyxPacking::repack( payload, numPayload, raw + dumpHeaderSize );
+    raw[dumpHeaderSize + numPacked] = 0xF7;
+
+    return AnymaSyx::isPatchDump( raw, (int) dump.getSize() );
+  }
+
+#pragma mark splitting
+  /** offsets and sizes of each F0..F7 message in a .syx bank */
+  static juce::Array<juce::Range<int> > splitSyxBank( const uint8_t* data, const int numBytes )
+  {
+    juce::Array<juce::Range<int> > messages;
+    int start = -1;
+    for( int i = 0; i < numBytes; ++i )
+    {
+      if( data[i] == 0xF0 ) start = i;
+      if( data[i] == 0xF7 && start >= 0 )
+      {
+        messages.add( juce::Range<int>( start, i + 1 ) );
+        start = -1;
+      }
+    }
+    return messages;
+  }
+
+  /** offsets and sizes of each record body (command byte + payload) in a .bin bank */
+  static juce::Array<juce::Range<int> > splitDecodedBank( const uint8_t* data, const int numBytes )
+  {
+    juce::Array<juce::Range<int> > records;
+    if( numBytes < 4 || memcmp( data, getDecodedMagic(), 4 ) != 0 ) return records;
+
+    for( int i = 4; i + 4 <= numBytes; )
+    {
+      const int length = (int) juce::ByteOrder::littleEndianInt( data + i );
+      i += 4;
+      if( length < 1 || length > numBytes - i ) break; // truncated
+      records.add( juce::Range<int>( i, i + length ) );
+      i += length;
+    }
+    return records;
+  }
+
+#pragma mark import and export
+  /** read, validate and file every patch in the given bank files. blocks
+      until done, run it off the message thread. if cancelled, the patches
+      written so far are still indexed */
+  static Result importBanks( const juce::Array<juce::File>& files, PatchLibrary& library,
+                             Progress* progress = nullptr )
+  {
+    const int chunkSize = 64; // patches per job, so one big bank still spreads over the pool
+    const double loadShare = 0.2; // of the progress bar, converting takes the rest
+
+    juce::OwnedArray<LoadJob> loads; // outlive the pool
+    juce::OwnedArray<ConvertJob> converts;
+    juce::ThreadPool pool( juce::jmax( 1, juce::SystemStats::getNumCpus() ) );
+    Result result;
+
+    for( auto& file : files ) pool.addJob( loads.add( new LoadJob( file ) ), false );
+
+    for( int i = 0; i < loads.size() && ! result.wasCancelled; ++i )
+    {
+      result.wasCancelled = ! waitForJob( pool, loads[i], progress );
+      if( progress != nullptr ) progress->setProportionDone( loadShare * (i + 1) / loads.size() );
+
+      for( int begin = 0; ! result.wasCancelled && begin < loads[i]->items.size(); begin += chunkSize )
+      {
+        const int end = juce::jmin( begin + chunkSize, loads[i]->items.size() );
+        pool.addJob( converts.add( new ConvertJob( *loads[i], begin, end, library ) ), false );
+      }
+    }
+
+    for( int i = 0; i < converts.size() && ! result.wasCancelled; ++i )
+    {
+      result.wasCancelled = ! waitForJob( pool, converts[i], progress );
+      if( progress != nullptr ) progress->setProportionDone( loadShare + (1.0 - loadShare) * (i + 1) / converts.size() );
+    }
+
+    // stop jobs mid chunk, each checks shouldExit() per patch
+    if( result.wasCancelled ) pool.removeAllJobs( true, -1 );
+
+    juce::SortedSet<PatchLibrary::Hash> written; // one file may hold a patch twice
+    for( auto* load : loads ) result.numFiles += load->isLoaded ? 1 : 0;
+    for( auto* convert : converts )
+    {
+      result.numDumps += convert->numDumps;
+      result.numInvalid += convert->numInvalid;
+      result.numFailed += convert->numFailed;
+      for( auto hash : convert->written ) written.add( hash );
+    }
+
+    juce::Array<PatchLibrary::Hash> hashes;
+    for( int i = 0; i < written.size(); ++i ) hashes.add( written[i] );
+    library.addToIndex( hashes ); // one lock, one change message
+    result.numNew = hashes.size();
+
+    return result;
+  }
+
+  /** write every stored patch to one bank, format by file extension.
+      returns patches written, -1 on failure or if cancelled (no file left) */
+  static int exportBank( const juce::File& file, PatchLibrary& library, Progress* progress = nullptr )
+  {
+    const int numWritten = writeBank( file, library, progress );
+    if( numWritten < 0 ) file.deleteFile();
+    return numWritten;
+  }
+
+private:
+  static int writeBank( const juce::File& file, PatchLibrary& library, Progress* progress )
+  {
+    const Format format = getFormat( file );
+
+    file.deleteFile();
+    juce::FileOutputStream out( file );
+    if( out.failedToOpen() ) return -1;
+    if( format == decodedBank && ! out.write( getDecodedMagic(), 4 ) ) return -1;
+
+    juce::MemoryBlock decoded; // scratch, reused for every patch
+    const juce::Array<PatchLibrary::Hash> hashes = library.getHashes();
+    int numWritten = 0;
+    for( int i = 0; i < hashes.size(); ++i )
+    {
+      if( progress != nullptr )
+      {
+        if( progress->isCancelled() ) return -1;
+        progress->setProportionDone( (double) i / hashes.size() );
+      }
+
+      juce::MemoryMappedFile mapped( library.getFile( hashes[i] ), juce::MemoryMappedFile::readOnly );
+      if( mapped.getData() == nullptr ) continue;
+
+      const uint8_t* raw = (const uint8_t*) mapped.getData();
+      const int numBytes = (int) mapped.getSize();
+
+      if( format == syxBank )
+      {
+        if( ! out.write( raw, (size_t) numBytes ) ) return -1;
+      }
+      else
+      {
+        const int numPayload = decodeDump( raw, numBytes, decoded );
+        if( numPayload < 0 ) continue;
+
+        if( ! out.writeInt( 1 + numPayload ) ) return -1; // little endian
+        if( ! out.writeByte( (char) raw[dumpHeaderSize - 1] ) ) return -1;
+        if( ! out.write( decoded.getData(), (size_t) numPayload ) ) return -1;
+      }
+      ++numWritten;
+    }
+
+    out.flush();
+    return numWritten;
+  }
+
+  /** false if cancelled before the job finished */
+  static bool waitForJob( juce::ThreadPool& pool, juce::ThreadPoolJob* job, Progress* progress )
+  {
+    while( ! pool.waitForJobToFinish( job, 50 ) )
+      if( progress != nullptr && progress->isCancelled() ) return false;
+
+    return progress == nullptr || ! progress->isCancelled();
+  }
+
+  // reads one bank file and finds its patches, run on a pool thread
+  class LoadJob : public juce::ThreadPoolJob
+  {
+  public:
+    juce::File file;
+    Format format;
+    bool isLoaded = false;
+    juce::MemoryBlock data;
+    juce::Array<juce::Range<int> > items; // dumps (.syx) or record bodies (.bin)
+
+    LoadJob( const juce::File& bankFile )
+      : juce::ThreadPoolJob( bankFile.getFileName() ), file( bankFile ), format( getFormat( bankFile ) )
+    {}
+
+    JobStatus runJob() override
+    {
+      isLoaded = file.loadFileAsData( data );
+      if( ! isLoaded ) return jobHasFinished;
+
+      const uint8_t* bytes = (const uint8_t*) data.getData();
+      const int numBytes = (int) data.getSize();
+      items = (format == syxBank) ? splitSyxBank( bytes, numBytes ) : splitDecodedBank( bytes, numBytes );
+      return jobHasFinished;
+    }
+  };
+
+  // converts, validates and writes a chunk of one bank's patches, run on a pool thread
+  class ConvertJob : public juce::ThreadPoolJob
+  {
+  public:
+    const LoadJob& load;
+    const int begin, end;
+    PatchLibrary& library;
+
+    int numDumps = 0, numInvalid = 0, numFailed = 0;
+    juce::Array<PatchLibrary::Hash> written;
+
+    ConvertJob( const LoadJob& bank, const int first, const int last, PatchLibrary& patchLibrary )
+      : juce::ThreadPoolJob( bank.file.getFileName() ), load( bank ), begin( first ), end( last ),
+        library( patchLibrary )
+    {}
+
+    JobStatus runJob() override
+    {
+      const uint8_t* bytes = (const uint8_t*) load.data.getData();
+      juce::MemoryBlock dump, decoded; // scratch, reused for every patch
+
+      for( int k = begin; k < end; ++k )
+      {
+        if( shouldExit() ) break;
+
+        const juce::Range<int> range = load.items.getReference( k );
+        const uint8_t* raw = bytes + range.getStart();
+        int numBytes = range.getLength();
+
+        if( load.format == decodedBank )
+        {
+          if( ! encodeDump( raw[0], raw + 1, numBytes - 1, dump ) ) { ++numInvalid; continue; }
+          raw = (const uint8_t*) dump.getData();
+          numBytes = (int) dump.getSize();
+        }
+
+        if( decodeDump( raw, numBytes, decoded ) < 0 ) { ++numInvalid; continue; }
+        ++numDumps;
+
+        // file i/o here on the pool, the index is only touched by addToIndex()
+        const PatchLibrary::Hash hash = PatchLibrary::hashDump( raw, numBytes );
+        if( library.contains( hash ) ) continue;
+
+        if( library.writeDump( hash, raw, numBytes ) ) written.add( hash );
+        else ++numFailed;
+      }
+
+      return jobHasFinished;
+    }
+  };
+};
@@ -0,0 +1,240 @@
+/*
+  PatchLibrary
+  Content addressed store of anyma patch dumps, indexed by hash of the dump.
+  Each unique dump lives once on disk as <hash>.syx, recalled memory-mapped.
+  Used to skip forwarding unchanged dumps and to recall a patch to the anyma.
+  New dumps from the midi thread are queued and written on a background thread.
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include "AnymaTranslator.h"
+#include "DumpFilter.h"
+
+//
+class PatchLibrary
+      : public juce::ChangeBroadcaster
+      , private juce::TimeSliceClient
+{
+public:
+  typedef DumpFilter::Hash Hash;
+
+  enum
+  {
+    queueSlots = 16,        // dumps waiting to be written
+    maxQueuedBytes = 8192   // larger dumps are forwarded but not filed
+  };
+
+private:
+  juce::File folder;
+  juce::SortedSet<Hash> index; // hashes of the dumps in folder
+  juce::CriticalSection lock;  // guards index reads and the final swap, never the midi thread
+  juce::CriticalSection updateLock; // serialises index rebuilds, held while merging
+
+  DumpFilter dumpFilter; // only changed patch dumps, midi thread
+
+  // preallocated single producer (midi thread) queue, drained by writerThread
+  juce::AbstractFifo queue { queueSlots };
+  juce::HeapBlock<Hash> queuedHash;
+  juce::HeapBlock<int> queuedSize;
+  juce::HeapBlock<uint8_t> queuedData; // queueSlots * maxQueuedBytes
+  juce::TimeSliceThread writerThread { "AnymaPal patch writer" };
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PatchLibrary)
+
+public:
+  PatchLibrary( const juce::File& libraryFolder = getDefaultFolder() )
+    : folder( libraryFolder )
+  {
+    queuedHash.calloc( queueSlots );
+    queuedSize.calloc( queueSlots );
+    queuedData.calloc( queueSlots * maxQueuedBytes );
+
+    folder.createDirectory();
+    rescan();
+
+    writerThread.addTimeSliceClient( this );
+    writerThread.startThread();
+  }
+
+  ~PatchLibrary()
+  {
+    writerThread.removeTimeSliceClient( this );
+    writerThread.stopThread( 2000 );
+    writeQueued(); // anything still waiting
+  }
+
+  static juce::File getDefaultFolder()
+  {
+    return juce::File::getSpecialLocation( juce::File::userApplicationDataDirectory )
+             .getChildFile( "AnymaPal" ).getChildFile( "Patches" );
+  }
+
+#pragma mark hashing
+  /** 64 bit FNV-1a over the whole dump, incl 0xF0 and 0xF7 terminator */
+  static Hash hashDump( const uint8_t* raw, const int numBytes )
+  { return DumpFilter::hashDump( raw, numBytes ); }
+
+  static Hash hashDump( const juce::MidiMessage& dump )
+  { return hashDump( dump.getRawData(), dump.getRawDataSize() ); }
+
+  static juce::String toString( const Hash hash )
+  { return juce::String::toHexString( (juce::int64) hash ).paddedLeft( '0', 16 ); }
+
+  juce::File getFile( const Hash hash ) const
+  { return folder.getChildFile( toString( hash ) + ".syx" ); }
+
+#pragma mark store and recall
+  /** midi thread: copy a dump into the write queue. no locks, no allocation,
+      no file i/o; the writer skips dumps already stored.
+      returns false if too large or queue full */
+  bool queueStore( const Hash hash, const uint8_t* raw, const int numBytes )
+  {
+    if( numBytes > maxQueuedBytes ) return false;
+
+    int start1, size1, start2, size2;
+    queue.prepareToWrite( 1, start1, size1, start2, size2 );
+    if( size1 < 1 ) return false; // writer is behind, drop rather than wait
+
+    queuedHash[start1] = hash;
+    queuedSize[start1] = numBytes;
+    memcpy( queuedData + start1 * maxQueuedBytes, raw, (size_t) numBytes );
+    queue.finishedWrite( 1 );
+
+    writerThread.notify();
+    return true;
+  }
+
+  bool queueStore( const Hash hash, const juce::MidiMessage& dump )
+  { return queueStore( hash, dump.getRawData(), dump.getRawDataSize() ); }
+
+  /** write <hash>.syx unless already on disk. no lock, safe from any thread */
+  bool writeDump( const Hash hash, const uint8_t* raw, const int numBytes ) const
+  {
+    juce::File file = getFile( hash );
+    if( file.getSize() == (juce::int64) numBytes ) return true; // already written
+
+    return file.replaceWithData( raw, (size_t) numBytes );
+  }
+
+  /** make written dumps visible. the merge happens on a copy, lock is only
+      held to copy and to swap, one change message per batch */
+  void addToIndex( const juce::Array<Hash>& hashes )
+  {
+    if( hashes.size() == 0 ) return;
+
+    const juce::ScopedLock ul( updateLock );
+    juce::SortedSet<Hash> updated;
+    {
+      const juce::ScopedLock sl( lock );
+      updated = index;
+    }
+
+    updated.ensureStorageAllocated( updated.size() + hashes.size() );
+    for( auto hash : hashes ) updated.add( hash );
+
+    swapIndex( updated );
+  }
+
+  /** write and index one dump now, on the calling thread. returns false if
+      already in the library or not written */
+  bool store( const Hash hash, const uint8_t* raw, const int numBytes )
+  {
+    if( contains( hash ) ) return false;
+    if( ! writeDump( hash, raw, numBytes ) ) return false;
+
+    juce::Array<Hash> hashes;
+    hashes.add( hash );
+    addToIndex( hashes );
+    return true;
+  }
+
+  /** send the stored dump to the anyma. returns false if unknown or unreadable */
+  bool recall( const Hash hash, juce::MidiOutput& midiToAnyma )
+  {
+    if( ! contains( hash ) ) return false;
+
+    juce::MemoryMappedFile mapped( getFile( hash ), juce::MemoryMappedFile::readOnly );
+    if( mapped.getData() == nullptr ) return false;
+    if( ! AnymaSyx::isPatchDump( (const uint8_t*) mapped.getData(), (int) mapped.getSize() ) ) return false;
+
+    midiToAnyma.sendMessageNow( juce::MidiMessage( mapped.getData(), (int) mapped.getSize(), 0 ) );
+    return true;
+  }
+
+  bool contains( const Hash hash )
+  {
+    const juce::ScopedLock sl( lock );
+    return index.contains( hash );
+  }
+
+  juce::Array<Hash> getHashes()
+  {
+    const juce::ScopedLock sl( lock );
+    juce::Array<Hash> hashes;
+    for( int i = 0; i < index.size(); ++i ) hashes.add( index[i] );
+    return hashes;
+  }
+
+  /** rebuild the index from the <hash>.syx files in folder, scanning
+      outside the lock and swapping the result in */
+  void rescan()
+  {
+    const juce::ScopedLock ul( updateLock );
+    juce::SortedSet<Hash> scanned;
+
+    juce::Array<juce::File> files;
+    folder.findChildFiles( files, juce::File::findFiles, false, "*.syx" );
+    for( auto& file : files )
+    {
+      const juce::String name = file.getFileNameWithoutExtension();
+      if( name.length() != 16 || ! name.containsOnly( "0123456789abcdef" ) ) continue;
+      scanned.add( (Hash) name.getHexValue64() );
+    }
+
+    swapIndex( scanned );
+  }
+
+#pragma mark forwarding
+  // see DumpFilter
+  void setForwardOnlyChanged( const bool onlyChanged ) { dumpFilter.setForwardOnlyChanged( onlyChanged ); }
+  bool isForwardOnlyChanged() const { return dumpFilter.isForwardOnlyChanged(); }
+  bool isForwardRequired( const Hash hash ) { return dumpFilter.isForwardRequired( hash ); }
+
+private:
+  void swapIndex( juce::SortedSet<Hash>& replacement )
+  {
+    {
+      const juce::ScopedLock sl( lock );
+      index.swapWith( replacement );
+    }
+    sendChangeMessage(); // async, listeners refresh on the message thread
+  }
+
+#pragma mark writer thread
+  int useTimeSlice() override
+  {
+    writeQueued();
+    return 500; // ms, queueStore() notifies sooner
+  }
+
+  void writeQueued()
+  {
+    juce::Array<Hash> written;
+
+    int start1, size1, start2, size2;
+    queue.prepareToRead( queue.getNumReady(), start1, size1, start2, size2 );
+    for( int i = 0; i < size1 + size2; ++i )
+    {
+      const int slot = (i < size1) ? start1 + i : start2 + i - size1;
+      if( contains( queuedHash[slot] ) || written.contains( queuedHash[slot] ) ) continue; // already stored
+      if( writeDump( queuedHash[slot], queuedData + slot * maxQueuedBytes, queuedSize[slot] ) )
+        written.add( queuedHash[slot] );
+    }
+    queue.finishedRead( size1 + size2 );
+
+    addToIndex( written );
+  }
+};
@@ -0,0 +1,151 @@
+/*
+  SyxPacking
+  7 bit safe sysex payload <> 8 bit data, as used in anyma patch dumps.
+  Each group of up to 7 data bytes is preceded by one byte holding their
+  high bits, bit i = high bit of data byte i.
+  Vector kernels (SSSE3 or aarch64 NEON) do two groups per step, the scalar
+  versions are the reference and handle the tail.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#if defined (__SSSE3__)
+ #include <tmmintrin.h>
+ #define ANYMAPAL_SYX_SSSE3 1
+#elif defined (__aarch64__) && defined (__ARM_NEON)
+ #include <arm_neon.h>
+ #define ANYMAPAL_SYX_NEON 1
+#endif
+
+namespace SyxPacking
+{
+  inline int getUnpackedSize( const int numPacked )
+  {
+    const int rem = numPacked % 8;
+    return (numPacked / 8) * 7 + (rem ? rem - 1 : 0);
+  }
+
+  inline int getPackedSize( const int numUnpacked )
+  {
+    const int rem = numUnpacked % 7;
+    return (numUnpacked / 7) * 8 + (rem ? rem + 1 : 0);
+  }
+
+#pragma mark scalar
+  /** returns number of bytes written to out, getUnpackedSize( numIn ) */
+  inline int unpackScalar( const uint8_t* in, const int numIn, uint8_t* out, int i = 0, int o = 0 )
+  {
+    for( ; i < numIn; i += 8 )
+    {
+      const uint8_t hi = in[i];
+      const int n = (numIn - i - 1 < 7) ? numIn - i - 1 : 7;
+      for( int j = 0; j < n; ++j )
+        out[o++] = (uint8_t) (in[i + 1 + j] | (((hi >> j) & 1) << 7));
+    }
+    return o;
+  }
+
+  /** returns number of bytes written to out, getPackedSize( numIn ) */
+  inline int repackScalar( const uint8_t* in, const int numIn, uint8_t* out, int i = 0, int o = 0 )
+  {
+    for( ; i < numIn; i += 7 )
+    {
+      const int n = (numIn - i < 7) ? numIn - i : 7;
+      uint8_t hi = 0;
+      for( int j = 0; j < n; ++j )
+      {
+        hi = (uint8_t) (hi | ((in[i + j] >> 7) << j));
+        out[o + 1 + j] = in[i + j] & 0x7F;
+      }
+      out[o] = hi;
+      o += n + 1;
+    }
+    return o;
+  }
+
+#pragma mark vector
+  /** same as unpackScalar, two groups (16 in, 14 out) per step */
+  inline int unpack( const uint8_t* in, const int numIn, uint8_t* out )
+  {
+    int i = 0, o = 0;
+
+   #if ANYMAPAL_SYX_SSSE3
+    const __m128i hiIdx   = _mm_setr_epi8( 0, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, -1, -1 );
+    const __m128i dataIdx = _mm_setr_epi8( 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, 15, -1, -1 );
+    const __m128i bits    = _mm_setr_epi8( 1, 2, 4, 8, 16, 32, 64, 1, 2, 4, 8, 16, 32, 64, 0, 0 );
+    const __m128i msb     = _mm_set1_epi8( (char) 0x80 );
+
+    // 16 byte store writes 2 bytes past the 14 produced, keep a group spare
+    for( ; i + 24 <= numIn; i += 16, o += 14 )
+    {
+      const __m128i x  = _mm_loadu_si128( (const __m128i*) (in + i) );
+      const __m128i hi = _mm_shuffle_epi8( x, hiIdx );
+      const __m128i d  = _mm_shuffle_epi8( x, dataIdx );
+      const __m128i set = _mm_cmpeq_epi8( _mm_and_si128( hi, bits ), bits );
+      _mm_storeu_si128( (__m128i*) (out + o), _mm_or_si128( d, _mm_and_si128( set, msb ) ) );
+    }
+   #elif ANYMAPAL_SYX_NEON
+    static const uint8_t hiIdxBytes[16]   = { 0, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 0xFF, 0xFF };
+    static const uint8_t dataIdxBytes[16] = { 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, 15, 0xFF, 0xFF };
+    static const uint8_t bitsBytes[16]    = { 1, 2, 4, 8, 16, 32, 64, 1, 2, 4, 8, 16, 32, 64, 0, 0 };
+    const uint8x16_t hiIdx   = vld1q_u8( hiIdxBytes );
+    const uint8x16_t dataIdx = vld1q_u8( dataIdxBytes );
+    const uint8x16_t bits    = vld1q_u8( bitsBytes );
+    const uint8x16_t msb     = vdupq_n_u8( 0x80 );
+
+    // 16 byte store writes 2 bytes past the 14 produced, keep a group spare
+    for( ; i + 24 <= numIn; i += 16, o += 14 )
+    {
+      const uint8x16_t x  = vld1q_u8( in + i );
+      const uint8x16_t hi = vqtbl1q_u8( x, hiIdx );
+      const uint8x16_t d  = vqtbl1q_u8( x, dataIdx );
+      vst1q_u8( out + o, vorrq_u8( d, vandq_u8( vtstq_u8( hi, bits ), msb ) ) );
+    }
+   #endif
+
+    return unpackScalar( in, numIn, out, i, o );
+  }
+
+  /** same as repackScalar, two groups (14 in, 16 out) per step */
+  inline int repack( const uint8_t* in, const int numIn, uint8_t* out )
+  {
+    int i = 0, o = 0;
+
+   #if ANYMAPAL_SYX_SSSE3
+    const __m128i idx  = _mm_setr_epi8( -1, 0, 1, 2, 3, 4, 5, 6, -1, 7, 8, 9, 10, 11, 12, 13 );
+    const __m128i low7 = _mm_set1_epi8( 0x7F );
+
+    // 16 byte load reads 2 bytes past the 14 consumed
+    for( ; i + 16 <= numIn; i += 14, o += 16 )
+    {
+      const __m128i x = _mm_loadu_si128( (const __m128i*) (in + i) );
+      const int m = _mm_movemask_epi8( x );
+      const __m128i hi = _mm_set_epi64x( (m >> 7) & 0x7F, m & 0x7F ); // bytes 0 and 8
+      const __m128i d = _mm_shuffle_epi8( _mm_and_si128( x, low7 ), idx );
+      _mm_storeu_si128( (__m128i*) (out + o), _mm_or_si128( d, hi ) );
+    }
+   #elif ANYMAPAL_SYX_NEON
+    static const uint8_t idxBytes[16] = { 0xFF, 0, 1, 2, 3, 4, 5, 6, 0xFF, 7, 8, 9, 10, 11, 12, 13 };
+    static const uint8_t w0Bytes[16]  = { 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    static const uint8_t w1Bytes[16]  = { 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, 0, 0 };
+    const uint8x16_t idx = vld1q_u8( idxBytes );
+    const uint8x16_t w0  = vld1q_u8( w0Bytes );
+    const uint8x16_t w1  = vld1q_u8( w1Bytes );
+
+    // 16 byte load reads 2 bytes past the 14 consumed
+    for( ; i + 16 <= numIn; i += 14, o += 16 )
+    {
+      const uint8x16_t x  = vld1q_u8( in + i );
+      const uint8x16_t b  = vshrq_n_u8( x, 7 );
+      uint8x16_t d = vqtbl1q_u8( vandq_u8( x, vdupq_n_u8( 0x7F ) ), idx );
+      d = vsetq_lane_u8( vaddvq_u8( vmulq_u8( b, w0 ) ), d, 0 );
+      d = vsetq_lane_u8( vaddvq_u8( vmulq_u8( b, w1 ) ), d, 8 );
+      vst1q_u8( out + o, d );
+    }
+   #endif
+
+    return repackScalar( in, numIn, out, i, o );
+  }
+}
@@ -0,0 +1,170 @@
+/*
+  SyxPackingTest
+  Cross-checks the vector 7 bit unpack/repack kernels against the scalar
+  reference, for every length up to maxLength and random data, then the
+  PatchBank dump validation and decoded .bin bank format built on them.
+  Run with: AnymaPal --unit-tests
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include "SyxPacking.h"
+#include "PatchBank.h"
+
+class SyxPackingTest : public juce::UnitTest
+{
+private:
+  enum { maxLength = 1024, rounds = 4, guardBytes = 32 };
+  const uint8_t guard = 0xEE; // must survive past the end of every output
+
+  enum { numBankPatches = 40, minPayload = 300 }; // lengths cover every final group size
+
+  static void randomPayload( juce::Random& random, const int numPayload, juce::MemoryBlock& payload )
+  {
+    payload.setSize( (size_t) numPayload );
+    for( int i = 0; i < numPayload; ++i ) ((uint8_t*) payload.getData())[i] = (uint8_t) random.nextInt( 256 );
+  }
+
+  /** .bin record: uint32 length (little endian), command byte, payload */
+  static void appendRecord( juce::MemoryOutputStream& bank, const uint8_t command, const juce::MemoryBlock& payload )
+  {
+    bank.writeInt( 1 + (int) payload.getSize() );
+    bank.writeByte( (char) command );
+    bank.write( payload.getData(), payload.getSize() );
+  }
+
+public:
+  SyxPackingTest() : juce::UnitTest( "SyxPacking" ) {}
+
+  void runTest() override
+  {
+    juce::Random random( 0x616e796d ); // fixed seed, failures reproduce
+
+    beginTest( "unpack matches scalar for every length" );
+    for( int numPacked = 0; numPacked <= maxLength; ++numPacked )
+    {
+      for( int round = 0; round < rounds; ++round )
+      {
+        juce::HeapBlock<uint8_t> packed( (size_t) numPacked + 1 );
+        for( int i = 0; i < numPacked; ++i ) packed[i] = (uint8_t) (random.nextInt( 128 ));
+
+        const int numOut = SyxPacking::getUnpackedSize( numPacked );
+        juce::HeapBlock<uint8_t> vector( (size_t) numOut + guardBytes ), scalar( (size_t) numOut + guardBytes );
+        memset( vector, guard, (size_t) numOut + guardBytes );
+        memset( scalar, guard, (size_t) numOut + guardBytes );
+
+        expectEquals( SyxPacking::unpack( packed, numPacked, vector ), numOut );
+        expectEquals( SyxPacking::unpackScalar( packed, numPacked, scalar ), numOut );
+        expect( memcmp( vector, scalar, (size_t) numOut + guardBytes ) == 0,
+                "unpack differs or overruns at length " + juce::String( numPacked ) );
+      }
+    }
+
+    beginTest( "repack matches scalar for every length" );
+    for( int numUnpacked = 0; numUnpacked <= maxLength; ++numUnpacked )
+    {
+      for( int round = 0; round < rounds; ++round )
+      {
+        juce::HeapBlock<uint8_t> unpacked( (size_t) numUnpacked + 1 );
+        for( int i = 0; i < numUnpacked; ++i ) unpacked[i] = (uint8_t) (random.nextInt( 256 ));
+
+        const int numOut = SyxPacking::getPackedSize( numUnpacked );
+        juce::HeapBlock<uint8_t> vector( (size_t) numOut + guardBytes ), scalar( (size_t) numOut + guardBytes );
+        memset( vector, guard, (size_t) numOut + guardBytes );
+        memset( scalar, guard, (size_t) numOut + guardBytes );
+
+        expectEquals( SyxPacking::repack( unpacked, numUnpacked, vector ), numOut );
+        expectEquals( SyxPacking::repackScalar( unpacked, numUnpacked, scalar ), numOut );
+        expect( memcmp( vector, scalar, (size_t) numOut + guardBytes ) == 0,
+                "repack differs or overruns at length " + juce::String( numUnpacked ) );
+
+        // and back again
+        bool isSevenBitSafe = true;
+        for( int i = 0; i < numOut; ++i ) isSevenBitSafe = isSevenBitSafe && vector[i] < 0x80;
+        expect( isSevenBitSafe, "repack output not 7 bit safe at length " + juce::String( numUnpacked ) );
+
+        juce::HeapBlock<uint8_t> roundTrip( (size_t) numUnpacked + 1 );
+        expectEquals( SyxPacking::unpack( vector, numOut, roundTrip ), numUnpacked );
+        expect( memcmp( roundTrip, unpacked, (size_t) numUnpacked ) == 0,
+                "round trip differs at length " + juce::String( numUnpacked ) );
+      }
+    }
+
+    beginTest( "stray high bits in a short final group are rejected" );
+    for( int numPayload = minPayload; numPayload < minPayload + 7; ++numPayload )
+    {
+      const int numLast = numPayload % 7; // data bytes in the final group, 0 = full
+      if( numLast == 0 ) continue;
+
+      juce::MemoryBlock payload, dump, decoded;
+      randomPayload( random, numPayload, payload );
+      expect( PatchBank::encodeDump( 0x11, (const uint8_t*) payload.getData(), numPayload, dump ) );
+      expectEquals( PatchBank::decodeDump( (const uint8_t*) dump.getData(), (int) dump.getSize(), decoded ), numPayload );
+
+      // bit j of a group header is the high bit of data byte j, none beyond numLast exist
+      uint8_t* raw = (uint8_t*) dump.getData();
+      const int lastHeader = PatchBank::dumpHeaderSize + (numPayload / 7) * 8;
+      raw[lastHeader] = (uint8_t) (raw[lastHeader] | (1 << 6));
+
+      // unpack alone ignores the stray bit, so the payload still looks intact
+      juce::HeapBlock<uint8_t> unpacked( (size_t) numPayload );
+      SyxPacking::unpack( raw + PatchBank::dumpHeaderSize, (int) dump.getSize() - PatchBank::dumpHeaderSize - 1, unpacked );
+      expect( memcmp( unpacked, payload.getData(), (size_t) numPayload ) == 0 );
+
+      expectEquals( PatchBank::decodeDump( raw, (int) dump.getSize(), decoded ), -1 );
+    }
+
+    beginTest( "truncated .bin record is dropped" );
+    {
+      juce::MemoryBlock first, second;
+      randomPayload( random, minPayload, first );
+      randomPayload( random, minPayload + 1, second );
+
+      juce::MemoryOutputStream bank;
+      bank.write( PatchBank::getDecodedMagic(), 4 );
+      appendRecord( bank, 0x11, first );
+      appendRecord( bank, 0x11, second );
+
+      const uint8_t* data = (const uint8_t*) bank.getData();
+      const int numBytes = (int) bank.getDataSize();
+      expectEquals( PatchBank::splitDecodedBank( data, numBytes ).size(), 2 );
+
+      for( int cut = 1; cut <= 4 + 1 + (int) second.getSize(); ++cut ) // into the length, then the body
+      {
+        const juce::Array<juce::Range<int> > records = PatchBank::splitDecodedBank( data, numBytes - cut );
+        expectEquals( records.size(), 1 );
+        if( records.size() == 1 ) expect( records[0] == juce::Range<int>( 8, 8 + 1 + minPayload ) );
+      }
+    }
+
+    beginTest( "decoded .bin bank export and import keep every hash" );
+    {
+      const juce::File folder = juce::File::getSpecialLocation( juce::File::tempDirectory )
+                                  .getNonexistentChildFile( "AnymaPalTest", "", false );
+      const juce::File bankFile = folder.getChildFile( "bank.bin" );
+      {
+        PatchLibrary source( folder.getChildFile( "source" ) );
+        for( int i = 0; i < numBankPatches; ++i )
+        {
+          juce::MemoryBlock payload, dump;
+          randomPayload( random, minPayload + i, payload );
+          expect( PatchBank::encodeDump( 0x11, (const uint8_t*) payload.getData(), (int) payload.getSize(), dump ) );
+          const uint8_t* raw = (const uint8_t*) dump.getData();
+          expect( source.store( PatchLibrary::hashDump( raw, (int) dump.getSize() ), raw, (int) dump.getSize() ) );
+        }
+        expectEquals( PatchBank::exportBank( bankFile, source ), (int) numBankPatches );
+
+        PatchLibrary imported( folder.getChildFile( "imported" ) );
+        const PatchBank::Result result = PatchBank::importBanks( juce::Array<juce::File>( &bankFile, 1 ), imported );
+        expectEquals( result.numFiles, 1 );
+        expectEquals( result.numDumps, (int) numBankPatches );
+        expectEquals( result.numInvalid, 0 );
+        expectEquals( result.numNew, (int) numBankPatches );
+        expect( imported.getHashes() == source.getHashes(), "imported hashes differ from exported" );
+      }
+      folder.deleteRecursively();
+    }
+  }
+};
+
+static SyxPackingTest syxPackingTest;
@@ -6,13 +6,15 @@
 
 #pragma once
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#ifndef JUCE_AUDIO_BASICS_H_INCLUDED // plugin build brings its own JuceHeader
+ #include "../JuceLibraryCode/JuceHeader.h"
+#endif
 
 //
 class SyxRepeater : private juce::Timer
 {
 private:
-  MidiOutput* midiOutput;
+  MidiOutput* midiOutput = nullptr;
   MidiMessage msg; // default is empty sysex message
   unsigned int interval = 1000;
 